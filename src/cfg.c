@@ -0,0 +1,181 @@
+#include "cfg.h"
+#include <stdio.h>
+#include <string.h>
+
+// Bytes taken by the r/m displacement for a given mod/rm pair.
+static int disp_length(unsigned char modrm) {
+    unsigned char mod = (modrm >> 6) & 3;
+    unsigned char rm  = modrm & 7;
+
+    switch (mod) {
+    case 0:  return rm == 6 ? 2 : 0;
+    case 1:  return 1;
+    case 2:  return 2;
+    default: return 0;
+    }
+}
+
+// Mirrors the opcode dispatch in decode_file().
+int insn_length(const uint8_t *p, size_t avail, uint16_t addr,
+                int *is_branch, uint16_t *target)
+{
+    unsigned char first = p[0];
+    int len = 0;
+
+    *is_branch = 0;
+
+    if (first == 0b00000100 || first == 0b00000101 ||   // add al/ax, imm
+        first == 0b00101100 || first == 0b00101101 ||   // sub al/ax, imm
+        first == 0b00111100 || first == 0b00111101) {   // cmp al/ax, imm
+        len = 2 + (first & 1);
+    }
+    else if ( (first & 0b11111100) == 0b10001000 ||     // 100010dw (MOV r/m <-> r)
+              (first & 0b11111100) == 0b00000000 ||     // 000000dw (ADD r/m <-> r)
+              (first & 0b11111100) == 0b00101000 ||     // 001010dw (SUB r/m <-> r)
+              (first & 0b11111100) == 0b00111000 ) {    // 001110dw (CMP r/m <-> r)
+        if (avail < 2) return 0;
+        len = 2 + disp_length(p[1]);
+    }
+    else if ( (first & 0b11110000) == 0b10110000 ) {    // 1011wreg (MOV imm -> reg)
+        len = 2 + ((first >> 3) & 1);
+    }
+    else if ( (first & 0b11111100) == 0b10000000 ) {    // 100000sw (ALU imm -> r/m)
+        if (avail < 2) return 0;
+        unsigned char reg = (p[1] >> 3) & 7;
+        if (reg != 0b000 && reg != 0b101 && reg != 0b111) return 0;  // add/sub/cmp only
+        unsigned char s = (first >> 1) & 1;
+        unsigned char w = first & 1;
+        len = 2 + disp_length(p[1]) + ((w && !s) ? 2 : 1);
+    }
+    else if ( (first & 0b11110000) == 0b01110000 ||     // 0111cccc (Jcc)
+              (first & 0b11111100) == 0b11100000 ) {    // loop/loopz/loopnz/jcxz
+        if (avail < 2) return 0;
+        len = 2;
+        *is_branch = 1;
+        *target = (uint16_t)(addr + 2 + (signed char)p[1]);
+    }
+    else {
+        return 0;
+    }
+
+    return (size_t)len <= avail ? len : 0;
+}
+
+static void add_block(Cfg *cfg, uint16_t start, uint16_t end, const uint8_t *image) {
+    if (cfg->n_blocks >= MAX_BLOCKS) return;
+
+    BasicBlock *b = &cfg->blocks[cfg->n_blocks++];
+    b->start  = start;
+    b->end    = end;
+    b->n_succ = 0;
+
+    // Successors come from the last instruction in the block.
+    uint16_t last = start;
+    for (uint16_t a = start; a < end; a += cfg->len[a]) last = a;
+
+    int is_branch;
+    uint16_t target;
+    insn_length(&image[last], cfg->size - last, last, &is_branch, &target);
+
+    if (end < cfg->size && cfg->kind[end] == BYTE_INSN)
+        b->succ[b->n_succ++] = end;
+    if (is_branch && target < cfg->size && cfg->kind[target] == BYTE_INSN && target != end)
+        b->succ[b->n_succ++] = target;
+}
+
+void cfg_build(Cfg *cfg, const uint8_t *image, size_t size, uint16_t entry)
+{
+    static uint16_t work[MAX_IMAGE];
+    size_t n_work = 0;
+
+    if (size > MAX_IMAGE) size = MAX_IMAGE;
+    cfg->size = size;
+    cfg->n_labels = 0;
+    cfg->n_blocks = 0;
+    memset(cfg->kind, BYTE_DATA, sizeof(cfg->kind));
+    memset(cfg->len, 0, sizeof(cfg->len));
+    memset(cfg->leader, 0, sizeof(cfg->leader));
+
+    if (entry < size) {
+        work[n_work++] = entry;
+        cfg->leader[entry] |= LEAD_BLOCK;
+    }
+
+    while (n_work > 0) {
+        uint16_t addr = work[--n_work];
+
+        // Walk straight-line code until a branch, an unsupported opcode or
+        // something we have already decoded.
+        while (addr < size && cfg->kind[addr] == BYTE_DATA) {
+            int is_branch;
+            uint16_t target;
+            int len = insn_length(&image[addr], size - addr, addr, &is_branch, &target);
+            if (len == 0) {
+                fprintf(stderr, "Unsupported instruction: 0x%02X at %04X\n", image[addr], addr);
+                break;
+            }
+
+            // Never let two instructions overlap.
+            int clash = 0;
+            for (int i = 1; i < len; i++)
+                if (cfg->kind[addr + i] != BYTE_DATA) clash = 1;
+            if (clash) break;
+
+            cfg->kind[addr] = BYTE_INSN;
+            cfg->len[addr] = (uint8_t)len;
+            for (int i = 1; i < len; i++) cfg->kind[addr + i] = BYTE_INSN_BODY;
+
+            uint16_t next = (uint16_t)(addr + len);
+            if (is_branch) {
+                if (target < size) {
+                    cfg->leader[target] |= LEAD_BLOCK | LEAD_TARGET;
+                    if (cfg->kind[target] == BYTE_DATA && n_work < MAX_IMAGE)
+                        work[n_work++] = target;
+                }
+                if (next < size) cfg->leader[next] |= LEAD_BLOCK;
+            }
+            addr = next;
+        }
+    }
+
+    // Labels in address order, only where a branch lands on a real
+    // instruction boundary.
+    for (size_t a = 0; a < size; a++) {
+        cfg->label[a] = -1;
+        if ((cfg->leader[a] & LEAD_TARGET) && cfg->kind[a] == BYTE_INSN)
+            cfg->label[a] = cfg->n_labels++;
+    }
+
+    // Basic blocks: runs of instructions cut at every leader.
+    size_t a = 0;
+    while (a < size) {
+        if (cfg->kind[a] != BYTE_INSN) { a++; continue; }
+
+        uint16_t start = (uint16_t)a;
+        do {
+            a += cfg->len[a];
+        } while (a < size && cfg->kind[a] == BYTE_INSN && !(cfg->leader[a] & LEAD_BLOCK));
+
+        add_block(cfg, start, (uint16_t)a, image);
+    }
+}
+
+int cfg_block_at(const Cfg *cfg, uint16_t addr) {
+    size_t lo = 0, hi = cfg->n_blocks;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cfg->blocks[mid].start < addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < cfg->n_blocks && cfg->blocks[lo].start == addr) ? (int)lo : -1;
+}
+
+void cfg_print(const Cfg *cfg) {
+    for (size_t i = 0; i < cfg->n_blocks; i++) {
+        const BasicBlock *b = &cfg->blocks[i];
+        printf("%04X-%04X", b->start, b->end);
+        if (b->n_succ) printf(" ->");
+        for (int s = 0; s < b->n_succ; s++) printf(" %04X", b->succ[s]);
+        putchar('\n');
+    }
+}
@@ -0,0 +1,56 @@
+// cfg.h
+#ifndef CFG_H
+#define CFG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_IMAGE  65536
+#define MAX_BLOCKS 4096
+
+typedef enum {
+    BYTE_DATA,        // never reached from the entry point
+    BYTE_INSN,        // first byte of a reachable instruction
+    BYTE_INSN_BODY    // operand bytes of that instruction
+} ByteKind;
+
+enum {
+    LEAD_BLOCK  = 1,  // starts a basic block
+    LEAD_TARGET = 2   // is the target of a branch (gets a label)
+};
+
+typedef struct {
+    uint16_t start, end;    // [start, end)
+    uint16_t succ[2];
+    uint8_t  n_succ;
+} BasicBlock;
+
+typedef struct {
+    size_t   size;
+    uint8_t  kind[MAX_IMAGE];
+    uint8_t  len[MAX_IMAGE];     // instruction length, at BYTE_INSN
+    uint8_t  leader[MAX_IMAGE];
+    int      label[MAX_IMAGE];   // -1 when the address has no label
+    int      n_labels;
+    BasicBlock blocks[MAX_BLOCKS];
+    size_t   n_blocks;
+} Cfg;
+
+// Length of the instruction at p (0 if unsupported or truncated). For
+// jcc/loop/jcxz, *target receives the absolute branch target.
+int insn_length(const uint8_t *p, size_t avail, uint16_t addr,
+                int *is_branch, uint16_t *target);
+
+// Recursive descent from entry: follows fallthrough and branch targets,
+// marks reachable instruction bytes, numbers branch targets as labels in
+// address order and splits the code into basic blocks. Anything that is
+// never reached stays BYTE_DATA.
+void cfg_build(Cfg *cfg, const uint8_t *image, size_t size, uint16_t entry);
+
+// Index of the block starting at addr, or -1.
+int cfg_block_at(const Cfg *cfg, uint16_t addr);
+
+// One line per block: "0000-0008 -> 0008 0012".
+void cfg_print(const Cfg *cfg);
+
+#endif
@@ -1,10 +1,31 @@
 #include "cpu.h"
 #include <stdio.h>
+#include <string.h>
 
 void cpu_init(CPU *cpu) {
     for(int i = 0; i < 8; i++) {
         cpu->r[i] = 0;
     }
+    for(int i = 0; i < F_UNKNOWN; i++) {
+        cpu->f[i] = 0;
+    }
+    cpu->ip = 0;
+    cpu->cycles = 0;
+    memset(cpu->mem, 0, sizeof(cpu->mem));
+}
+
+// cpu_init() for repeat runs: only the first 64K is addressable, so only
+// that much memory is cleared.
+void cpu_reset(CPU *cpu) {
+    for(int i = 0; i < 8; i++) {
+        cpu->r[i] = 0;
+    }
+    for(int i = 0; i < F_UNKNOWN; i++) {
+        cpu->f[i] = 0;
+    }
+    cpu->ip = 0;
+    cpu->cycles = 0;
+    memset(cpu->mem, 0, 0x10000);
 }
 
 void cpu_print(const CPU *cpu)
@@ -12,10 +33,11 @@ void cpu_print(const CPU *cpu)
     printf(
         "AX=%04X  BX=%04X  CX=%04X  DX=%04X\n"
         "SP=%04X  BP=%04X  SI=%04X  DI=%04X\n"
-        "ZF=%d  SF=%d\n",
+        "IP=%04X  ZF=%d  SF=%d  CF=%d  OF=%d  PF=%d\n"
+        "CYCLES=%llu\n",
         cpu->r[AX], cpu->r[BX], cpu->r[CX], cpu->r[DX],
         cpu->r[SP], cpu->r[BP], cpu->r[SI], cpu->r[DI],
-        cpu->f[ZF], cpu->f[SF]
+        cpu->ip, cpu->f[ZF], cpu->f[SF], cpu->f[CF], cpu->f[OF], cpu->f[PF],
+        (unsigned long long)cpu->cycles
     );
 }
-
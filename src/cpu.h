@@ -3,20 +3,28 @@
 
 #include <stdint.h>
 
+// Segments are not modelled: every guest address is a 16-bit offset into
+// the first 64K of mem[], and accesses and ranges wrap from 0xFFFF to 0.
+#define MEM_SIZE (1u << 20)   // 20-bit physical address space
+
 typedef enum {
   AX, BX, CX, DX, SP, BP, SI, DI, REG_UNKNOWN
 } Reg16;
 
 typedef enum {
-  ZF, SF, F_UNKNOWN
+  ZF, SF, CF, OF, PF, F_UNKNOWN
 } Flags;
 
 typedef struct {
   uint16_t r[REG_UNKNOWN];
-  u_int8_t f[F_UNKNOWN];
+  uint8_t f[F_UNKNOWN];
+  uint16_t ip;
+  uint64_t cycles;
+  uint8_t mem[MEM_SIZE];
 } CPU;
 
 void cpu_init(CPU *cpu);
+void cpu_reset(CPU *cpu);
 void cpu_print(const CPU *cpu);
 
-#endif
\ No newline at end of file
+#endif
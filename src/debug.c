@@ -0,0 +1,57 @@
+#include "debug.h"
+#include <stdio.h>
+
+Debugger dbg;
+
+static void set_bit(uint8_t *bits, uint32_t addr) {
+    addr &= MEM_SIZE - 1;
+    bits[addr >> 3] |= (uint8_t)(1u << (addr & 7));
+}
+
+void dbg_add_break(uint32_t addr) {
+    set_bit(dbg.break_bits, addr);
+    dbg.n_break++;
+}
+
+// Ranges wrap at 64K the same way the simulator's memory helpers do.
+void dbg_add_watch(uint32_t addr, uint32_t len, int mode) {
+    if (len == 0) len = 1;
+    for (uint32_t i = 0; i < len; i++) {
+        if (mode & WATCH_READ)  set_bit(dbg.read_bits, (uint16_t)(addr + i));
+        if (mode & WATCH_WRITE) set_bit(dbg.write_bits, (uint16_t)(addr + i));
+    }
+    dbg.n_watch++;
+}
+
+// Called from the memory helpers only when dbg.n_watch != 0.
+// The first hit wins; the run loop stops once the instruction retires.
+void dbg_check_access(uint32_t addr, uint32_t len, int mode, uint16_t ip) {
+    if (dbg.hit.kind != DBG_NONE) return;
+
+    const uint8_t *bits = (mode == WATCH_READ) ? dbg.read_bits : dbg.write_bits;
+    for (uint32_t i = 0; i < len; i++) {
+        uint16_t a = (uint16_t)(addr + i);
+        if (dbg_bit(bits, a)) {
+            dbg.hit.kind = (mode == WATCH_READ) ? DBG_WATCH_READ : DBG_WATCH_WRITE;
+            dbg.hit.addr = a;
+            dbg.hit.ip   = ip;
+            return;
+        }
+    }
+}
+
+void dbg_report(void) {
+    switch (dbg.hit.kind) {
+    case DBG_BREAK:
+        printf("breakpoint at %05X\n", dbg.hit.addr);
+        break;
+    case DBG_WATCH_READ:
+        printf("read watchpoint at %05X (ip %04X)\n", dbg.hit.addr, dbg.hit.ip);
+        break;
+    case DBG_WATCH_WRITE:
+        printf("write watchpoint at %05X (ip %04X)\n", dbg.hit.addr, dbg.hit.ip);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,51 @@
+// debug.h
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// Breakpoints and watchpoints are kept as bitmaps over the 20-bit address
+// space. The simulator only looks at them when the matching count is
+// nonzero, so a run with nothing set pays a single predictable branch.
+
+typedef enum {
+    DBG_NONE,
+    DBG_BREAK,
+    DBG_WATCH_READ,
+    DBG_WATCH_WRITE
+} DbgHitKind;
+
+enum {
+    WATCH_READ  = 1,
+    WATCH_WRITE = 2
+};
+
+typedef struct {
+    DbgHitKind kind;
+    uint32_t addr;   // breakpoint address or memory address touched
+    uint16_t ip;     // instruction that caused the hit
+} DbgHit;
+
+typedef struct {
+    uint32_t n_break;
+    uint32_t n_watch;
+    DbgHit hit;
+    uint8_t break_bits[MEM_SIZE / 8];
+    uint8_t read_bits[MEM_SIZE / 8];
+    uint8_t write_bits[MEM_SIZE / 8];
+} Debugger;
+
+extern Debugger dbg;
+
+void dbg_add_break(uint32_t addr);
+void dbg_add_watch(uint32_t addr, uint32_t len, int mode);
+void dbg_check_access(uint32_t addr, uint32_t len, int mode, uint16_t ip);
+void dbg_report(void);
+
+static inline int dbg_bit(const uint8_t *bits, uint32_t addr) {
+    addr &= MEM_SIZE - 1;
+    return (bits[addr >> 3] >> (addr & 7)) & 1;
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include "decoder.h"
 
+static uint8_t image[MAX_IMAGE];
+static Cfg cfg;
+
 static const char *reg8[8]  = { "al","cl","dl","bl","ah","ch","dh","bh" };
 static const char *reg16[8] = { "ax","cx","dx","bx","sp","bp","si","di" };
 static const char *ea_table[8] = {
@@ -20,6 +23,18 @@ static const char *jcc_table[16] = {
     "jl",   "jnl",  "jle",  "jg"
 };
 
+// Branch operand: the target's label when the analysis gave it one,
+// otherwise the raw relative offset.
+static void print_target(FILE *in, signed char off, FILE *out)
+{
+    long target = ftell(in) + off;
+
+    if (target >= 0 && (size_t)target < cfg.size && cfg.label[target] >= 0)
+        fprintf(out, "label_%d", cfg.label[target]);
+    else
+        fprintf(out, "%d", (int)off);
+}
+
 void handle_jcc(unsigned char first, FILE *in, FILE *out)
 {
     int b = fgetc(in);
@@ -28,7 +43,8 @@ void handle_jcc(unsigned char first, FILE *in, FILE *out)
     signed char off = (signed char)b;
     unsigned char cc = first & 0b00001111;
 
-    fprintf(out, "%s %d", jcc_table[cc], (int)off);
+    fprintf(out, "%s ", jcc_table[cc]);
+    print_target(in, off, out);
 }
 
 void handle_loop_family(unsigned char first, FILE *in, FILE *out)
@@ -39,11 +55,12 @@ void handle_loop_family(unsigned char first, FILE *in, FILE *out)
     signed char off = (signed char)b;
 
     switch (first) {
-    case 0b11100010: fprintf(out, "loop %d",   (int)off); break;
-    case 0b11100001: fprintf(out, "loopz %d",  (int)off); break;
-    case 0b11100000: fprintf(out, "loopnz %d", (int)off); break;
-    case 0b11100011: fprintf(out, "jcxz %d",   (int)off); break;
+    case 0b11100010: fprintf(out, "loop ");   break;
+    case 0b11100001: fprintf(out, "loopz ");  break;
+    case 0b11100000: fprintf(out, "loopnz "); break;
+    case 0b11100011: fprintf(out, "jcxz ");   break;
     }
+    print_target(in, off, out);
 }
 
 static const char *alu_imm_op(unsigned char reg) {
@@ -457,64 +474,96 @@ void handle_alu_acc_imm(unsigned char first, FILE *in, FILE *out) {
     }
 }
 
-void decode_file(FILE *in, FILE *out)
+static void decode_insn(unsigned char first, FILE *in, FILE *out)
 {
-    int byte;
+    if (first == 0b00000100 || first == 0b00000101 ||   // add al/ax, imm
+        first == 0b00101100 || first == 0b00101101 ||   // sub al/ax, imm
+        first == 0b00111100 || first == 0b00111101) {   // cmp al/ax, imm
+        handle_alu_acc_imm(first, in, out);
+    }
+    else if ( (first & 0b11111100) == 0b10001000 ) {           // 100010dw (MOV r/m <-> r)
+        handle_mov_rm_r(first, in, out);
+    }
+    else if ( (first & 0b11110000) == 0b10110000 ) {           // 1011wreg (MOV imm -> reg)
+        handle_mov_imm_r(first, in, out);
+    }
+    else if ( (first & 0b11111100) == 0b10000000 ) {           // 100000sw (ALU imm -> r/m)
+        handle_alu_imm_rm(first, in, out);
+    }
+    else if ( (first & 0b11111100) == 0b00000000 ) {           // 000000dw (ADD r/m <-> r)
+        handle_alu_rm_r("add", first, in, out);
+    }
+    else if ( (first & 0b11111100) == 0b00101000 ) {           // 001010dw (SUB r/m <-> r)
+        handle_alu_rm_r("sub", first, in, out);
+    }
+    else if ( (first & 0b11111100) == 0b00111000 ) {           // 001110dw (CMP r/m <-> r)
+        handle_alu_rm_r("cmp", first, in, out);
+    }
 
-    while ((byte = fgetc(in)) != EOF) {
-        unsigned char first = (unsigned char)byte;
-        // unsigned char opcode = first >> 2;
+    else if ( (first & 0b11110000) == 0b01110000 ) {                 // 0111cccc
+        handle_jcc(first, in, out);
+    }
 
-        if (first == 0b00000100 || first == 0b00000101 ||   // add al/ax, imm
-            first == 0b00101100 || first == 0b00101101 ||   // sub al/ax, imm
-            first == 0b00111100 || first == 0b00111101) {   // cmp al/ax, imm
-            handle_alu_acc_imm(first, in, out);
-        }
-        else if ( (first & 0b11111100) == 0b10001000 ) {           // 100010dw (MOV r/m <-> r)
-            handle_mov_rm_r(first, in, out);
-        }
-        else if ( (first & 0b11110000) == 0b10110000 ) {           // 1011wreg (MOV imm -> reg)
-            handle_mov_imm_r(first, in, out);
-        }
-        else if ( (first & 0b11111100) == 0b10000000 ) {           // 100000sw (ALU imm -> r/m)
-            handle_alu_imm_rm(first, in, out);
-        }
-        else if ( (first & 0b11111100) == 0b00000000 ) {           // 000000dw (ADD r/m <-> r)
-            handle_alu_rm_r("add", first, in, out);
-        }
-        else if ( (first & 0b11111100) == 0b00101000 ) {           // 001010dw (SUB r/m <-> r)
-            handle_alu_rm_r("sub", first, in, out);
-        }
-        else if ( (first & 0b11111100) == 0b00111000 ) {           // 001110dw (CMP r/m <-> r)
-            handle_alu_rm_r("cmp", first, in, out);
-        }
+    else if ( first == 0b11100010 || first == 0b11100001 ||
+            first == 0b11100000 || first == 0b11100011 ) {    // loop/loopz/loopnz/jcxz
+        handle_loop_family(first, in, out);
+    }
+}
 
-        else if ( (first & 0b11110000) == 0b01110000 ) {                 // 0111cccc
-            handle_jcc(first, in, out);
-        }
-        
-        else if ( first == 0b11100010 || first == 0b11100001 ||
-                first == 0b11100000 || first == 0b11100011 ) {    // loop/loopz/loopnz/jcxz
-            handle_loop_family(first, in, out);
-        }
-        else {
-            fprintf(stderr, "Unsupported instruction: 0x%02X\n", first);
-            return;
-        }
+static void add_line(Program *prog, LineKind kind, size_t addr, size_t size)
+{
+    if (!prog || prog->count >= MAX_LINES) return;
 
-        // switch (opcode) {
-        // case 0b100010:  // MOV
-        //     handle_mov(first, in, out);
-        //     break;
+    prog->addr[prog->count] = (uint16_t)addr;
+    prog->size[prog->count] = (uint8_t)size;
+    prog->kind[prog->count] = (uint8_t)kind;
+    prog->count++;
+}
 
-        // default:
-        //     fprintf(stderr, "Unsupported instruction: 0x%02X\n", first);
-        //     return;
-        // }
+// Lays the listing out from the control-flow graph rather than a linear
+// sweep: reachable instructions are decoded (with labels on branch
+// targets), everything else is emitted as db lines.
+void decode_file(FILE *in, FILE *out, Program *prog)
+{
+    size_t size = fread(image, 1, sizeof(image), in);
+    cfg_build(&cfg, image, size, 0);
 
-        fputc('\n', out);
+    if (prog) {
+        prog->count = 0;
+        prog->cfg = &cfg;
     }
-}
 
+    size_t addr = 0;
+    while (addr < size) {
+        if (cfg.kind[addr] == BYTE_INSN) {
+            if (cfg.label[addr] >= 0) {
+                fprintf(out, "label_%d:\n", cfg.label[addr]);
+                add_line(prog, LINE_LABEL, addr, 0);
+            }
+
+            fseek(in, (long)addr + 1, SEEK_SET);
+            decode_insn(image[addr], in, out);
+            fputc('\n', out);
 
+            // insn_length() keeps its own copy of the length rules; catch
+            // it drifting from the handlers above.
+            long used = ftell(in) - (long)addr;
+            if (used != cfg.len[addr])
+                fprintf(stderr, "Length mismatch at %04zX: decoder read %ld bytes, cfg says %d\n",
+                        addr, used, cfg.len[addr]);
 
+            add_line(prog, LINE_INSN, addr, cfg.len[addr]);
+            addr += cfg.len[addr];
+        } else {
+            size_t start = addr;
+            fprintf(out, "db ");
+            while (addr < size && cfg.kind[addr] != BYTE_INSN && addr - start < 16) {
+                fprintf(out, "%s0x%02X", addr == start ? "" : ", ", image[addr]);
+                addr++;
+            }
+            fputc('\n', out);
+
+            add_line(prog, LINE_DATA, start, addr - start);
+        }
+    }
+}
@@ -3,7 +3,27 @@
 #define DECODER_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include "cfg.h"
 
-void decode_file(FILE *in, FILE *out);
+#define MAX_LINES 65536
+
+typedef enum {
+    LINE_INSN,
+    LINE_LABEL,
+    LINE_DATA
+} LineKind;
+
+// What decode_file() produced: where each line of the listing came from
+// in the input image, plus the control-flow graph it was laid out from.
+typedef struct {
+    uint16_t addr[MAX_LINES];
+    uint8_t  size[MAX_LINES];
+    uint8_t  kind[MAX_LINES];
+    size_t   count;
+    const Cfg *cfg;
+} Program;
+
+void decode_file(FILE *in, FILE *out, Program *prog);
 
 #endif
@@ -1,15 +1,136 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "decoder.h"
 #include "simulator.h"
+#include "debug.h"
+#include "profiler.h"
 #include "cpu.h"
 
+#define DEFAULT_MAX_STEPS 1000000
+
 CPU cpu;
+Program prog;
+uint64_t max_steps = DEFAULT_MAX_STEPS;
+int print_cfg;
+int print_time;
+uint64_t repeat = 1;
+int fast_forward = 1;
+const char *profile_path;
+uint64_t sample_every = PROF_DEFAULT_PERIOD;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s <input.bin> <output.asm> [options]\n"
+            "       %s --bench-handlers N\n"
+            "  --break ADDR          stop before executing ADDR (ADDR <= 0xFFFF)\n"
+            "  --watch ADDR[:LEN]    stop after a write to [ADDR, ADDR+LEN)\n"
+            "  --rwatch ADDR[:LEN]   stop after a read\n"
+            "  --awatch ADDR[:LEN]   stop after a read or write\n"
+            "  --max-steps N         stop after N instructions (0 = no limit, default %d)\n"
+            "  --cfg                 print the basic blocks found in the input\n"
+            "  --time                report execution time on stderr\n"
+            "  --repeat N            run the program N times from reset (for --time)\n"
+            "  --no-fast-forward     step counted loops and spin-waits one by one\n"
+            "  --profile FILE        write sampled guest stacks to FILE (folded format)\n"
+            "  --sample-every N      instructions between samples (default %d)\n"
+            "  --bench-handlers N    time each specialised mov/add/sub/cmp handler\n"
+            "                        against the generic one, N executions each\n",
+            prog, prog, DEFAULT_MAX_STEPS, PROF_DEFAULT_PERIOD);
+}
+
+// "0x100" / "256" / "0x100:4"; a length is only accepted when allow_len
+// is set.
+static int parse_range(const char *s, int allow_len, uint32_t *addr, uint32_t *len)
+{
+    char *end;
+    *addr = (uint32_t)strtoul(s, &end, 0);
+    *len = 1;
+    if (end == s) return 0;
+    if (*end == ':') {
+        if (!allow_len) return 0;
+        const char *l = end + 1;
+        *len = (uint32_t)strtoul(l, &end, 0);
+        if (end == l || *len == 0 || *len > 0x10000) return 0;
+    }
+    return *end == '\0' && *addr <= 0xFFFF;
+}
+
+static int parse_args(int argc, char *argv[])
+{
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--cfg") == 0) {
+            print_cfg = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--time") == 0) {
+            print_time = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--profile") == 0) {
+            if (i + 1 >= argc) return 0;
+            profile_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--sample-every") == 0) {
+            char *end;
+            if (i + 1 >= argc) return 0;
+            sample_every = strtoull(argv[++i], &end, 0);
+            if (*end != '\0' || sample_every == 0) return 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-fast-forward") == 0) {
+            fast_forward = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--repeat") == 0) {
+            char *end;
+            if (i + 1 >= argc) return 0;
+            repeat = strtoull(argv[++i], &end, 0);
+            if (*end != '\0' || repeat == 0) return 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--max-steps") == 0) {
+            char *end;
+            if (i + 1 >= argc) return 0;
+            max_steps = strtoull(argv[++i], &end, 0);
+            if (*end != '\0') return 0;
+            continue;
+        }
+
+        int mode = 0;
+        if      (strcmp(argv[i], "--break") == 0)  mode = -1;
+        else if (strcmp(argv[i], "--watch") == 0)  mode = WATCH_WRITE;
+        else if (strcmp(argv[i], "--rwatch") == 0) mode = WATCH_READ;
+        else if (strcmp(argv[i], "--awatch") == 0) mode = WATCH_READ | WATCH_WRITE;
+        else return 0;
+
+        uint32_t addr, len;
+        if (i + 1 >= argc || !parse_range(argv[++i], mode >= 0, &addr, &len)) return 0;
+
+        if (mode < 0) dbg_add_break(addr);
+        else dbg_add_watch(addr, len, mode);
+    }
+    return 1;
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input.bin> <output.asm>\n", argv[0]);
+    if (argc == 3 && strcmp(argv[1], "--bench-handlers") == 0) {
+        char *end;
+        uint64_t n = strtoull(argv[2], &end, 0);
+        if (*end != '\0' || n == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        simulate_bench_handlers(n);
+        return 0;
+    }
+
+    if (argc < 3 || !parse_args(argc, argv)) {
+        usage(argv[0]);
         return 1;
     }
 
@@ -27,13 +148,53 @@ int main(int argc, char *argv[])
     }
 
     cpu_init(&cpu);
-    decode_file(in, out);
+    if (profile_path) prof_init(sample_every, cpu.ip);
+    decode_file(in, out, &prog);
+    if (print_cfg) cfg_print(prog.cfg);
     rewind(out);
-    simulate(&cpu, out);
+    simulate_load(out, &prog, fast_forward);
+
+    // Only execution is timed: loading and the resets between repeats
+    // are not part of it.
+    long long ns = 0;
+    uint64_t steps = 0;
+    for (uint64_t r = 0; r < repeat; r++) {
+        if (r) {
+            cpu_reset(&cpu);
+            dbg.hit.kind = DBG_NONE;
+            if (profile_path) prof_restart(cpu.ip);
+        }
+
+        struct timespec t0, t1;
+        timespec_get(&t0, TIME_UTC);
+        steps += simulate(&cpu, max_steps);
+        timespec_get(&t1, TIME_UTC);
+
+        ns += (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL
+            + (t1.tv_nsec - t0.tv_nsec);
+        if (sim_fault) break;
+    }
+
+    if (print_time) {
+        fprintf(stderr, "time: %lld ns, %llu instructions, %.6f ns/instruction\n",
+                ns, (unsigned long long)steps, steps ? (double)ns / (double)steps : 0.0);
+    }
+
+    dbg_report();
     cpu_print(&cpu);
 
+    if (profile_path) {
+        FILE *pf = fopen(profile_path, "w");
+        if (!pf) {
+            perror("Failed to open profile file");
+        } else {
+            prof_write(pf, prog.cfg);
+            fclose(pf);
+        }
+    }
+
     fclose(in);
     fclose(out);
 
-    return 0;
+    return sim_fault ? 1 : 0;
 }
@@ -0,0 +1,120 @@
+#include "profiler.h"
+#include <string.h>
+
+Profiler prof;
+
+void prof_init(uint64_t period, uint16_t entry) {
+    memset(&prof, 0, sizeof(prof));
+    prof.period = period;
+    prof.countdown = period;
+    prof.stack[0] = entry;
+    prof.depth = 1;
+}
+
+// Starts another run from entry, keeping the samples taken so far.
+void prof_restart(uint16_t entry) {
+    prof.countdown = prof.period;
+    prof.stack[0] = entry;
+    prof.depth = 1;
+}
+
+void prof_call(uint16_t target) {
+    if (prof.depth < PROF_MAX_DEPTH) prof.stack[prof.depth] = target;
+    if (prof.depth < UINT8_MAX) prof.depth++;
+}
+
+void prof_ret(void) {
+    if (prof.depth > 1) prof.depth--;
+}
+
+static uint32_t sample_hash(uint8_t depth, uint16_t ip) {
+    uint32_t h = 2166136261u;
+    for (uint8_t i = 0; i < depth; i++) h = (h ^ prof.stack[i]) * 16777619u;
+    return (h ^ ip) * 16777619u;
+}
+
+static void add_samples(uint16_t ip, uint64_t count) {
+    prof.total += count;
+
+    uint8_t depth = prof.depth < PROF_MAX_DEPTH ? prof.depth : PROF_MAX_DEPTH;
+    uint32_t h = sample_hash(depth, ip);
+
+    for (uint32_t i = 0; i < PROF_TABLE_SIZE; i++) {
+        ProfSample *s = &prof.table[(h + i) & (PROF_TABLE_SIZE - 1)];
+
+        if (s->count == 0) {
+            memcpy(s->frames, prof.stack, depth * sizeof(prof.stack[0]));
+            s->depth = depth;
+            s->ip = ip;
+            s->count = count;
+            return;
+        }
+        if (s->ip == ip && s->depth == depth &&
+            memcmp(s->frames, prof.stack, depth * sizeof(prof.stack[0])) == 0) {
+            s->count += count;
+            return;
+        }
+    }
+    prof.dropped += count;
+}
+
+void prof_sample(uint16_t ip) {
+    prof.countdown = prof.period;
+    add_samples(ip, 1);
+}
+
+// For fast-forwarded loops and spins: n instructions ran without going
+// through prof_tick(), cycling through ips[0..len) from ips[0]. Each
+// sampling point they cover goes to the instruction that was running.
+// Sample i lands at offset (countdown - 1 + i * period) % len, which
+// repeats every len samples, so only the first len need looking at.
+void prof_skip(const uint16_t *ips, uint32_t len, uint64_t n) {
+    if (!prof.period) return;
+    if (n < prof.countdown) {
+        prof.countdown -= n;
+        return;
+    }
+
+    uint64_t samples = 1 + (n - prof.countdown) / prof.period;
+    for (uint64_t i = 0; i < samples && i < len; i++) {
+        uint64_t pos = (prof.countdown - 1 + (i % len) * (prof.period % len)) % len;
+        add_samples(ips[pos], (samples - i + len - 1) / len);
+    }
+    prof.countdown = prof.period - (n - prof.countdown) % prof.period;
+}
+
+// Nearest label at or before addr, or -1.
+static int label_before(const Cfg *cfg, uint16_t addr) {
+    for (long a = addr; a >= 0; a--)
+        if ((size_t)a < cfg->size && cfg->label[a] >= 0) return cfg->label[a];
+    return -1;
+}
+
+static void print_symbol(FILE *out, const Cfg *cfg, uint16_t addr) {
+    int l = label_before(cfg, addr);
+    if (l >= 0) fprintf(out, "label_%d", l);
+    else fprintf(out, "entry");
+}
+
+void prof_write(FILE *out, const Cfg *cfg) {
+    for (uint32_t i = 0; i < PROF_TABLE_SIZE; i++) {
+        const ProfSample *s = &prof.table[i];
+        if (s->count == 0) continue;
+
+        for (uint8_t f = 0; f < s->depth; f++) {
+            if (f) fputc(';', out);
+            print_symbol(out, cfg, s->frames[f]);
+        }
+
+        // Innermost label inside the current routine, then the exact
+        // CS:IP (CS is always 0).
+        int routine = label_before(cfg, s->frames[s->depth - 1]);
+        int block = label_before(cfg, s->ip);
+        if (block != routine) fprintf(out, ";label_%d", block);
+        fprintf(out, ";0000:%04X %llu\n", s->ip, (unsigned long long)s->count);
+    }
+
+    if (prof.dropped)
+        fprintf(stderr, "profiler: %llu samples dropped (table full)\n",
+                (unsigned long long)prof.dropped);
+}
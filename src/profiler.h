@@ -0,0 +1,57 @@
+// profiler.h
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cfg.h"
+
+#define PROF_DEFAULT_PERIOD 1000
+#define PROF_MAX_DEPTH      64
+#define PROF_TABLE_SIZE     8192
+#define PROF_MAX_PASS       256     // longest loop pass or spin period
+                                    // fast-forwarded while profiling
+
+// Sampling profiler. Every `period` guest instructions the current CS:IP
+// and shadow call stack are counted; prof_write() emits them as folded
+// stacks ("entry;label_2;0000:00C7 42") for flamegraph.pl and friends.
+// With period == 0 the run loop pays one test per instruction.
+
+typedef struct {
+    uint16_t frames[PROF_MAX_DEPTH];
+    uint8_t  depth;
+    uint16_t ip;
+    uint64_t count;
+} ProfSample;
+
+typedef struct {
+    uint64_t period;
+    uint64_t countdown;
+    uint64_t total;
+    uint64_t dropped;     // samples that did not fit in the table
+
+    // Shadow call stack: routine entry addresses, root first. CALL/RET
+    // handlers are meant to push and pop here; the decoder does not
+    // produce them yet, so for now this is only the entry frame.
+    uint16_t stack[PROF_MAX_DEPTH];
+    uint8_t  depth;
+
+    ProfSample table[PROF_TABLE_SIZE];
+} Profiler;
+
+extern Profiler prof;
+
+void prof_init(uint64_t period, uint16_t entry);
+void prof_restart(uint16_t entry);
+void prof_call(uint16_t target);
+void prof_ret(void);
+void prof_sample(uint16_t ip);
+void prof_skip(const uint16_t *ips, uint32_t len, uint64_t n);
+void prof_write(FILE *out, const Cfg *cfg);
+
+// Called once per executed instruction.
+static inline void prof_tick(uint16_t ip) {
+    if (prof.period && --prof.countdown == 0) prof_sample(ip);
+}
+
+#endif
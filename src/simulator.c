@@ -1,22 +1,93 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "simulator.h"
+#include "debug.h"
+#include "profiler.h"
 #include "string.h"
 #include <ctype.h>
+#include <time.h>
 
 typedef enum {
     OP_ADD,
     OP_SUB,
     OP_CMP,
     OP_MOV,
+    OP_JCC,
+    OP_LOOP,
+    OP_LOOPZ,
+    OP_LOOPNZ,
+    OP_JCXZ,
     OP_UNKNOWN
 } Op;
 
+typedef enum {
+    OPND_NONE,
+    OPND_REG16,
+    OPND_REG8,
+    OPND_MEM,
+    OPND_IMM
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int size;        // 0 = unspecified, 1 = byte, 2 = word
+    Reg16 reg;       // REG16/REG8
+    int hi;          // REG8: ah/bh/ch/dh
+    Reg16 base;      // MEM: REG_UNKNOWN when absent
+    Reg16 index;
+    int16_t disp;
+    int has_disp;    // MEM: displacement was written out, even if 0
+    int32_t imm;     // IMM
+} Operand;
+
+typedef struct Instr Instr;
+typedef void (*ExecFn)(CPU *cpu, const Instr *in);
+
+// One listing line, parsed once before execution starts.
+struct Instr {
+    Op op;
+    uint8_t cc;       // OP_JCC condition, same order as the decoder's jcc_table
+    uint8_t wide;
+    uint8_t brk;      // breakpoint set on this instruction
+    uint16_t addr;
+    uint16_t next;
+    uint16_t target;  // branches
+    uint8_t cycles;   // 8086 clocks; not-taken time for branches
+    uint8_t taken_cycles;
+    uint8_t pure;     // writes nothing but flags (cmp, jcc, jcxz)
+    uint8_t ff;       // loop closing a block that can be run in closed form
+    uint16_t ff_steps;    // body instructions before the loop
+    uint32_t ff_cycles;   // clocks for one pass over the body
+    ExecFn exec;      // mov/add/sub/cmp: handler picked at predecode
+    Operand dst;
+    Operand src;
+};
+
+static const char *jcc_names[16] = {
+    "jo",   "jno",  "jb",   "jnb",
+    "je",   "jne",  "jbe",  "ja",
+    "js",   "jns",  "jp",   "jnp",
+    "jl",   "jnl",  "jle",  "jg"
+};
+
+int sim_fault;
+
+static Instr code[MAX_LINES];
+static int32_t code_at[MAX_IMAGE];      // address -> index into code, or -1
+static size_t image_size;
+static uint16_t label_addr[MAX_LINES];
+
 Op parse_op(const char *w) {
     if (strcmp(w, "add") == 0) return OP_ADD;
     if (strcmp(w, "sub") == 0) return OP_SUB;
     if (strcmp(w, "cmp") == 0) return OP_CMP;
     if (strcmp(w, "mov") == 0) return OP_MOV;
+    if (strcmp(w, "loop") == 0) return OP_LOOP;
+    if (strcmp(w, "loopz") == 0) return OP_LOOPZ;
+    if (strcmp(w, "loopnz") == 0) return OP_LOOPNZ;
+    if (strcmp(w, "jcxz") == 0) return OP_JCXZ;
+    for (int i = 0; i < 16; i++)
+        if (strcmp(w, jcc_names[i]) == 0) return OP_JCC;
     return OP_UNKNOWN;
 }
 
@@ -32,6 +103,18 @@ Reg16 parse_reg(const char *w) {
     return REG_UNKNOWN;
 }
 
+Reg16 parse_reg8(const char *w, int *hi) {
+    if (strlen(w) != 2 || (w[1] != 'l' && w[1] != 'h')) return REG_UNKNOWN;
+    *hi = (w[1] == 'h');
+    switch (w[0]) {
+    case 'a': return AX;
+    case 'b': return BX;
+    case 'c': return CX;
+    case 'd': return DX;
+    default:  return REG_UNKNOWN;
+    }
+}
+
 char line[128];
 char word[32];
 
@@ -51,122 +134,747 @@ char *consume_word(char *p) {
     return p;
 }
 
-void simulate_mov(CPU *cpu) {
-    char *p = &line;
-    p = consume_word(p);
-    p = consume_word(p);
-    Reg16 reg1 = parse_reg(&word);
-    long imm;
+// "[bx + si - 4]" / "[4834]"
+static int parse_mem(const char *p, Operand *o) {
+    o->kind  = OPND_MEM;
+    o->base  = REG_UNKNOWN;
+    o->index = REG_UNKNOWN;
+    o->disp  = 0;
+    o->has_disp = 0;
 
-    p = consume_word(p);
-    Reg16 reg2 = parse_reg(&word);
-    if(reg2 == REG_UNKNOWN) {
-       imm = strtol(word, NULL, 0);
-       cpu->r[reg1] = imm;
-    } else {
-        cpu->r[reg1] = cpu->r[reg2];
+    int sign = 1;
+    p++; // '['
+    while (*p && *p != ']') {
+        if (isspace((unsigned char)*p)) { p++; continue; }
+        if (*p == '+') { sign = 1;  p++; continue; }
+        if (*p == '-') { sign = -1; p++; continue; }
+
+        if (isdigit((unsigned char)*p)) {
+            char *end;
+            long v = strtol(p, &end, 0);
+            o->disp = (int16_t)(o->disp + sign * v);
+            o->has_disp = 1;
+            p = end;
+        } else {
+            char name[4] = {0};
+            int n = 0;
+            while (isalpha((unsigned char)*p) && n < 3) name[n++] = *p++;
+            Reg16 r = parse_reg(name);
+            if (r == REG_UNKNOWN) return 0;
+            if (o->base == REG_UNKNOWN) o->base = r;
+            else o->index = r;
+        }
     }
+    return *p == ']';
 }
 
-void simulate_add(CPU *cpu) {
-    char *p = &line;
-    p = consume_word(p);
-    p = consume_word(p);
-    Reg16 reg1 = parse_reg(&word);
-    long imm;
+static int parse_operand(char *p, Operand *o) {
+    while (*p && isspace((unsigned char)*p)) p++;
+    char *end = p + strlen(p);
+    while (end > p && isspace((unsigned char)end[-1])) *--end = '\0';
 
-    p = consume_word(p);
-    Reg16 reg2 = parse_reg(&word);
-    if(reg2 == REG_UNKNOWN) {
-       imm = strtol(word, NULL, 0);
-       cpu->r[reg1] += imm;
-    } else {
-        cpu->r[reg1] += cpu->r[reg2];
+    o->size = 0;
+    if (strncmp(p, "byte ", 5) == 0) { o->size = 1; p += 5; }
+    else if (strncmp(p, "word ", 5) == 0) { o->size = 2; p += 5; }
+
+    if (*p == '[') return parse_mem(p, o);
+
+    int hi = 0;
+    Reg16 r = parse_reg(p);
+    if (r != REG_UNKNOWN) {
+        o->kind = OPND_REG16; o->reg = r; o->size = 2;
+        return 1;
+    }
+    r = parse_reg8(p, &hi);
+    if (r != REG_UNKNOWN) {
+        o->kind = OPND_REG8; o->reg = r; o->hi = hi; o->size = 1;
+        return 1;
+    }
+    if (*p == '-' || isdigit((unsigned char)*p)) {
+        o->kind = OPND_IMM; o->imm = (int32_t)strtol(p, NULL, 0);
+        return 1;
     }
+    return 0;
+}
+
+// Splits "<mnemonic> dst, src" (line already past the mnemonic).
+static int parse_operands(char *p, Operand *dst, Operand *src, int *wide) {
+    char *comma = strchr(p, ',');
+    if (!comma) return 0;
+    *comma = '\0';
 
-    //zf
-    if(cpu->r[reg1] == 0) cpu->f[ZF] = 1;
-    else cpu->f[ZF] = 0;
+    if (!parse_operand(p, dst) || !parse_operand(comma + 1, src)) return 0;
+    if (dst->kind == OPND_IMM) return 0;
 
-    //sf
-    cpu->f[SF] = (cpu->r[reg1] & 0xFFFF) >> 15;
+    int size = dst->size ? dst->size : src->size;
+    *wide = (size != 1);
+    return 1;
 }
 
-void simulate_sub(CPU *cpu) {
-    char *p = &line;
-    p = consume_word(p);
-    p = consume_word(p);
-    Reg16 reg1 = parse_reg(&word);
-    long imm;
+static uint16_t operand_ea(const CPU *cpu, const Operand *o) {
+    uint16_t ea = (uint16_t)o->disp;
+    if (o->base != REG_UNKNOWN)  ea += cpu->r[o->base];
+    if (o->index != REG_UNKNOWN) ea += cpu->r[o->index];
+    return ea;
+}
 
-    p = consume_word(p);
-    Reg16 reg2 = parse_reg(&word);
-    if(reg2 == REG_UNKNOWN) {
-       imm = strtol(word, NULL, 0);
-       cpu->r[reg1] -= imm;
+static uint16_t mem_read8(CPU *cpu, uint16_t ea) {
+    if (dbg.n_watch) dbg_check_access(ea, 1, WATCH_READ, cpu->ip);
+    return cpu->mem[ea];
+}
+
+static uint16_t mem_read16(CPU *cpu, uint16_t ea) {
+    if (dbg.n_watch) dbg_check_access(ea, 2, WATCH_READ, cpu->ip);
+    return (uint16_t)(cpu->mem[ea] | (cpu->mem[(uint16_t)(ea + 1)] << 8));
+}
+
+static void mem_write8(CPU *cpu, uint16_t ea, uint16_t v) {
+    if (dbg.n_watch) dbg_check_access(ea, 1, WATCH_WRITE, cpu->ip);
+    cpu->mem[ea] = (uint8_t)v;
+}
+
+static void mem_write16(CPU *cpu, uint16_t ea, uint16_t v) {
+    if (dbg.n_watch) dbg_check_access(ea, 2, WATCH_WRITE, cpu->ip);
+    cpu->mem[ea] = (uint8_t)v;
+    cpu->mem[(uint16_t)(ea + 1)] = (uint8_t)(v >> 8);
+}
+
+static uint16_t mem_read(CPU *cpu, uint16_t ea, int wide) {
+    return wide ? mem_read16(cpu, ea) : mem_read8(cpu, ea);
+}
+
+static void mem_write(CPU *cpu, uint16_t ea, int wide, uint16_t v) {
+    if (wide) mem_write16(cpu, ea, v);
+    else mem_write8(cpu, ea, v);
+}
+
+static uint16_t read_operand(CPU *cpu, const Operand *o, int wide) {
+    switch (o->kind) {
+    case OPND_REG16: return cpu->r[o->reg];
+    case OPND_REG8:  return o->hi ? cpu->r[o->reg] >> 8 : cpu->r[o->reg] & 0xFF;
+    case OPND_MEM:   return mem_read(cpu, operand_ea(cpu, o), wide);
+    case OPND_IMM:   return (uint16_t)(wide ? o->imm : (o->imm & 0xFF));
+    default:         return 0;
+    }
+}
+
+static void write_operand(CPU *cpu, const Operand *o, int wide, uint16_t v) {
+    switch (o->kind) {
+    case OPND_REG16:
+        cpu->r[o->reg] = v;
+        break;
+    case OPND_REG8:
+        if (o->hi) cpu->r[o->reg] = (uint16_t)((cpu->r[o->reg] & 0x00FF) | ((v & 0xFF) << 8));
+        else       cpu->r[o->reg] = (uint16_t)((cpu->r[o->reg] & 0xFF00) | (v & 0xFF));
+        break;
+    case OPND_MEM:
+        mem_write(cpu, operand_ea(cpu, o), wide, v);
+        break;
+    default:
+        break;
+    }
+}
+
+static void set_flags(CPU *cpu, uint16_t a, uint16_t b, uint16_t res, int wide, int sub) {
+    uint16_t sign = wide ? 0x8000 : 0x80;
+    uint16_t mask = wide ? 0xFFFF : 0xFF;
+
+    cpu->f[ZF] = ((res & mask) == 0);
+    cpu->f[SF] = (res & sign) != 0;
+
+    if (sub) {
+        cpu->f[CF] = a < b;
+        cpu->f[OF] = ((a ^ b) & (a ^ res) & sign) != 0;
     } else {
-        cpu->r[reg1] -= cpu->r[reg2];
+        cpu->f[CF] = (uint32_t)a + b > mask;
+        cpu->f[OF] = (~(a ^ b) & (a ^ res) & sign) != 0;
     }
-    
-    //zf
-    if(cpu->r[reg1] == 0) cpu->f[ZF] = 1;
-    else cpu->f[ZF] = 0;
 
-    //sf
-    cpu->f[SF] = (cpu->r[reg1] & 0xFFFF) >> 15;
+    // even number of set bits in the low byte
+    uint8_t p = (uint8_t)res;
+    p ^= p >> 4; p ^= p >> 2; p ^= p >> 1;
+    cpu->f[PF] = !(p & 1);
 }
 
-void simulate_cmp(CPU *cpu) {
-    char *p = &line;
-    p = consume_word(p);
-    p = consume_word(p);
-    Reg16 reg1 = parse_reg(&word);
-    long imm;
-    u_int16_t temp = cpu->r[reg1];
+static int condition(const CPU *cpu, uint8_t cc) {
+    int r;
+    switch (cc >> 1) {
+    case 0:  r = cpu->f[OF]; break;                                  // jo
+    case 1:  r = cpu->f[CF]; break;                                  // jb
+    case 2:  r = cpu->f[ZF]; break;                                  // je
+    case 3:  r = cpu->f[CF] || cpu->f[ZF]; break;                    // jbe
+    case 4:  r = cpu->f[SF]; break;                                  // js
+    case 5:  r = cpu->f[PF]; break;                                  // jp
+    case 6:  r = cpu->f[SF] != cpu->f[OF]; break;                    // jl
+    default: r = cpu->f[ZF] || (cpu->f[SF] != cpu->f[OF]); break;    // jle
+    }
+    return (cc & 1) ? !r : r;
+}
 
-    p = consume_word(p);
-    Reg16 reg2 = parse_reg(&word);
-    if(reg2 == REG_UNKNOWN) {
-       imm = strtol(word, NULL, 0);
-       temp -= imm;
+void simulate_mov(CPU *cpu, const Instr *in) {
+    write_operand(cpu, &in->dst, in->wide, read_operand(cpu, &in->src, in->wide));
+}
+
+void simulate_alu(CPU *cpu, const Instr *in) {
+    uint16_t a = read_operand(cpu, &in->dst, in->wide);
+    uint16_t b = read_operand(cpu, &in->src, in->wide);
+    uint16_t mask = in->wide ? 0xFFFF : 0xFF;
+    uint16_t res = (in->op == OP_ADD) ? a + b : a - b;
+    res &= mask;
+
+    if (in->op != OP_CMP) write_operand(cpu, &in->dst, in->wide, res);
+    set_flags(cpu, a, b, res, in->wide, in->op != OP_ADD);
+}
+
+#ifndef NO_SPECIALISED_HANDLERS
+
+/*
+ * Specialised mov/add/sub/cmp handlers, one per (operation, width,
+ * destination form, source form). The generic path above decides all of
+ * that per execution; these are stamped out by the macros below so each
+ * predecoded instruction jumps straight to straight-line code.
+ *
+ * Operand forms: R register, I immediate, MD [disp], MB [reg + disp],
+ * MBX [reg + reg + disp]. A missing displacement is just disp = 0, so
+ * the decoder's mod field does not need variants of its own.
+ */
+
+#define EA_MD(o)   ((uint16_t)(o).disp)
+#define EA_MB(o)   ((uint16_t)((o).disp + cpu->r[(o).base]))
+#define EA_MBX(o)  ((uint16_t)((o).disp + cpu->r[(o).base] + cpu->r[(o).index]))
+
+#define RD_R_16(o)    cpu->r[(o).reg]
+#define RD_R_8(o)     ((uint16_t)((cpu->r[(o).reg] >> ((o).hi << 3)) & 0xFF))
+#define RD_I_16(o)    ((uint16_t)(o).imm)
+#define RD_I_8(o)     ((uint16_t)((o).imm & 0xFF))
+#define RD_MD_16(o)   mem_read16(cpu, EA_MD(o))
+#define RD_MD_8(o)    mem_read8(cpu, EA_MD(o))
+#define RD_MB_16(o)   mem_read16(cpu, EA_MB(o))
+#define RD_MB_8(o)    mem_read8(cpu, EA_MB(o))
+#define RD_MBX_16(o)  mem_read16(cpu, EA_MBX(o))
+#define RD_MBX_8(o)   mem_read8(cpu, EA_MBX(o))
+
+#define WR_R_16(o, v)    cpu->r[(o).reg] = (v)
+#define WR_R_8(o, v)     cpu->r[(o).reg] = (uint16_t)((cpu->r[(o).reg] & ~(0xFF << ((o).hi << 3))) \
+                                                      | (((v) & 0xFF) << ((o).hi << 3)))
+#define WR_MD_16(o, v)   mem_write16(cpu, EA_MD(o), v)
+#define WR_MD_8(o, v)    mem_write8(cpu, EA_MD(o), v)
+#define WR_MB_16(o, v)   mem_write16(cpu, EA_MB(o), v)
+#define WR_MB_8(o, v)    mem_write8(cpu, EA_MB(o), v)
+#define WR_MBX_16(o, v)  mem_write16(cpu, EA_MBX(o), v)
+#define WR_MBX_8(o, v)   mem_write8(cpu, EA_MBX(o), v)
+
+#define MASK_16  0xFFFFu
+#define MASK_8   0xFFu
+
+// ZF/SF/PF are the same for every operation; PF folds the low byte.
+#define FLAGS_SZP(W, res)                                                   \
+    uint8_t pf = (uint8_t)(res);                                            \
+    pf ^= pf >> 4; pf ^= pf >> 2; pf ^= pf >> 1;                            \
+    cpu->f[ZF] = (res) == 0;                                                \
+    cpu->f[SF] = ((res) >> ((W) - 1)) & 1;                                  \
+    cpu->f[PF] = !(pf & 1);
+
+#define FLAGS_add(W, a, b, res)                                             \
+    FLAGS_SZP(W, res)                                                       \
+    cpu->f[CF] = (uint32_t)(a) + (b) > MASK_##W;                            \
+    cpu->f[OF] = ((~((a) ^ (b)) & ((a) ^ (res))) >> ((W) - 1)) & 1;
+
+#define FLAGS_sub(W, a, b, res)                                             \
+    FLAGS_SZP(W, res)                                                       \
+    cpu->f[CF] = (a) < (b);                                                 \
+    cpu->f[OF] = ((((a) ^ (b)) & ((a) ^ (res))) >> ((W) - 1)) & 1;
+
+#define HANDLER_mov(W, D, S)                                                \
+    static void mov_##D##_##S##_##W(CPU *cpu, const Instr *in) {            \
+        WR_##D##_##W(in->dst, RD_##S##_##W(in->src));                       \
+    }
+
+#define HANDLER_alu(NAME, EXPR, FLAGS, STORE, W, D, S)                      \
+    static void NAME##_##D##_##S##_##W(CPU *cpu, const Instr *in) {         \
+        uint16_t a = RD_##D##_##W(in->dst);                                 \
+        uint16_t b = RD_##S##_##W(in->src);                                 \
+        uint16_t res = (uint16_t)((EXPR) & MASK_##W);                       \
+        STORE(WR_##D##_##W(in->dst, res);)                                  \
+        FLAGS(W, a, b, res)                                                 \
+    }
+
+#define KEEP(x) x
+#define DROP(x)
+
+#define HANDLER_add(W, D, S) HANDLER_alu(add, a + b, FLAGS_add, KEEP, W, D, S)
+#define HANDLER_sub(W, D, S) HANDLER_alu(sub, a - b, FLAGS_sub, KEEP, W, D, S)
+#define HANDLER_cmp(W, D, S) HANDLER_alu(cmp, a - b, FLAGS_sub, DROP, W, D, S)
+
+// Every destination/source pairing the decoder can produce.
+#define FORMS(X, OP, W)                                                     \
+    X(OP, W, R, R)   X(OP, W, R, I)                                         \
+    X(OP, W, R, MD)  X(OP, W, R, MB)  X(OP, W, R, MBX)                      \
+    X(OP, W, MD, R)  X(OP, W, MB, R)  X(OP, W, MBX, R)                      \
+    X(OP, W, MD, I)  X(OP, W, MB, I)  X(OP, W, MBX, I)
+
+#define VARIANTS(X)                                                         \
+    FORMS(X, mov, 8) FORMS(X, mov, 16)                                      \
+    FORMS(X, add, 8) FORMS(X, add, 16)                                      \
+    FORMS(X, sub, 8) FORMS(X, sub, 16)                                      \
+    FORMS(X, cmp, 8) FORMS(X, cmp, 16)
+
+#define DEFINE_HANDLER(OP, W, D, S) HANDLER_##OP(W, D, S)
+VARIANTS(DEFINE_HANDLER)
+
+typedef enum { FORM_R, FORM_I, FORM_MD, FORM_MB, FORM_MBX } Form;
+
+#define OPCODE_mov OP_MOV
+#define OPCODE_add OP_ADD
+#define OPCODE_sub OP_SUB
+#define OPCODE_cmp OP_CMP
+
+typedef struct {
+    Op op;
+    uint8_t wide;
+    Form dst, src;
+    const char *name;
+    ExecFn fn;
+} Variant;
+
+#define VARIANT_ENTRY(OP, W, D, S) \
+    { OPCODE_##OP, (W) == 16, FORM_##D, FORM_##S, #OP "." #W " " #D "," #S, OP##_##D##_##S##_##W },
+
+static const Variant variants[] = { VARIANTS(VARIANT_ENTRY) };
+
+static Form operand_form(const Operand *o) {
+    switch (o->kind) {
+    case OPND_IMM: return FORM_I;
+    case OPND_MEM:
+        if (o->base == REG_UNKNOWN)  return FORM_MD;
+        if (o->index == REG_UNKNOWN) return FORM_MB;
+        return FORM_MBX;
+    default:       return FORM_R;
+    }
+}
+
+static const Variant *find_variant(const Instr *in) {
+    Form d = operand_form(&in->dst), s = operand_form(&in->src);
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        const Variant *v = &variants[i];
+        if (v->op == in->op && v->wide == in->wide && v->dst == d && v->src == s)
+            return v;
+    }
+    return NULL;
+}
+
+#endif // NO_SPECIALISED_HANDLERS
+
+static ExecFn pick_handler(const Instr *in) {
+#ifndef NO_SPECIALISED_HANDLERS
+    const Variant *v = find_variant(in);
+    if (v) return v->fn;
+#endif
+    return in->op == OP_MOV ? simulate_mov : simulate_alu;
+}
+
+// Returns 1 when the branch is taken.
+int simulate_branch(CPU *cpu, const Instr *in) {
+    int taken;
+
+    switch (in->op) {
+    case OP_JCC:
+        taken = condition(cpu, in->cc);
+        break;
+    case OP_LOOP:
+        taken = --cpu->r[CX] != 0;
+        break;
+    case OP_LOOPZ:
+        taken = --cpu->r[CX] != 0 && cpu->f[ZF];
+        break;
+    case OP_LOOPNZ:
+        taken = --cpu->r[CX] != 0 && !cpu->f[ZF];
+        break;
+    case OP_JCXZ:
+        taken = cpu->r[CX] == 0;
+        break;
+    default:
+        taken = 0;
+        break;
+    }
+    return taken;
+}
+
+// Effective-address clocks (8086 manual, table 2-20).
+static int ea_cycles(const Operand *o) {
+    int n = (o->base != REG_UNKNOWN) + (o->index != REG_UNKNOWN);
+
+    if (n == 0) return 6;
+    if (n == 1) return o->has_disp ? 9 : 5;
+
+    // bp+di and bx+si are a clock faster than bp+si and bx+di
+    int fast = (o->base == BP && o->index == DI) || (o->base == DI && o->index == BP) ||
+               (o->base == BX && o->index == SI) || (o->base == SI && o->index == BX);
+    return (fast ? 7 : 8) + (o->has_disp ? 4 : 0);
+}
+
+// Clocks for the forms the decoder produces. Odd-address word transfers
+// (+4) are not modelled.
+static void instr_cycles(Instr *in) {
+    const Operand *d = &in->dst, *s = &in->src;
+    int mem_d = d->kind == OPND_MEM, mem_s = s->kind == OPND_MEM;
+    int ea = mem_d ? ea_cycles(d) : mem_s ? ea_cycles(s) : 0;
+
+    switch (in->op) {
+    case OP_MOV:
+        if (mem_d)                    in->cycles = (s->kind == OPND_IMM ? 10 : 9) + ea;
+        else if (mem_s)               in->cycles = 8 + ea;
+        else                          in->cycles = s->kind == OPND_IMM ? 4 : 2;
+        break;
+    case OP_ADD:
+    case OP_SUB:
+        if (mem_d)                    in->cycles = (s->kind == OPND_IMM ? 17 : 16) + ea;
+        else if (mem_s)               in->cycles = 9 + ea;
+        else                          in->cycles = s->kind == OPND_IMM ? 4 : 3;
+        break;
+    case OP_CMP:
+        if (mem_d)                    in->cycles = (s->kind == OPND_IMM ? 10 : 9) + ea;
+        else if (mem_s)               in->cycles = 9 + ea;
+        else                          in->cycles = s->kind == OPND_IMM ? 4 : 3;
+        break;
+    case OP_JCC:    in->cycles = 4; in->taken_cycles = 16; break;
+    case OP_LOOP:   in->cycles = 5; in->taken_cycles = 17; break;
+    case OP_LOOPZ:  in->cycles = 6; in->taken_cycles = 18; break;
+    case OP_LOOPNZ: in->cycles = 5; in->taken_cycles = 19; break;
+    case OP_JCXZ:   in->cycles = 6; in->taken_cycles = 18; break;
+    default:        break;
+    }
+}
+
+static int reads_cx(const Operand *o) {
+    return (o->kind == OPND_REG16 || o->kind == OPND_REG8) && o->reg == CX;
+}
+
+// A counted loop can skip its remaining iterations in one go when it
+// closes a basic block whose other instructions only compare registers
+// it never changes: each pass then leaves everything but CX, the step
+// count and the clock exactly as it found it.
+static void mark_counted_loop(Instr *in, const Program *prog) {
+    if (in->op != OP_LOOP && in->op != OP_LOOPZ && in->op != OP_LOOPNZ) return;
+    if (in->target > in->addr) return;
+
+    int b = cfg_block_at(prog->cfg, in->target);
+    if (b < 0 || prog->cfg->blocks[b].end != in->next) return;
+
+    uint16_t steps = 0;
+    uint32_t clocks = 0;
+    for (uint16_t a = in->target; a != in->addr; ) {
+        const Instr *body = &code[code_at[a]];
+        if (body->op != OP_CMP || body->brk) return;
+        if (body->dst.kind == OPND_MEM || body->src.kind == OPND_MEM) return;
+        if (reads_cx(&body->dst) || reads_cx(&body->src)) return;
+
+        steps++;
+        clocks += body->cycles;
+        a = body->next;
+    }
+    if (in->brk) return;
+
+    in->ff = 1;
+    in->ff_steps = steps;
+    in->ff_cycles = clocks;
+}
+
+// Instructions one pass of a fast-forwarded loop or spin visits, in
+// order, so prof_skip() can charge the skipped samples where they fall.
+static uint16_t pass_ips[PROF_MAX_PASS];
+
+// The loop instruction, then its body.
+static uint32_t loop_pass(const Instr *in) {
+    if (in->ff_steps + 1u > PROF_MAX_PASS) return 0;
+
+    uint32_t n = 0;
+    pass_ips[n++] = in->addr;
+    for (uint16_t a = in->target; a != in->addr; a = code[code_at[a]].next)
+        pass_ips[n++] = a;
+    return n;
+}
+
+// Replays one period of a spin from cpu->ip. Pure instructions only
+// touch the flags and IP, and a full period puts both back.
+static uint32_t spin_pass(CPU *cpu, uint64_t period) {
+    if (period > PROF_MAX_PASS) return 0;
+
+    for (uint32_t i = 0; i < period; i++) {
+        const Instr *in = &code[code_at[cpu->ip]];
+        pass_ips[i] = in->addr;
+        if (in->op == OP_CMP) in->exec(cpu, in);
+        cpu->ip = (in->op != OP_CMP && simulate_branch(cpu, in)) ? in->target : in->next;
+    }
+    return (uint32_t)period;
+}
+
+static int loop_keeps_going(const CPU *cpu, const Instr *in) {
+    switch (in->op) {
+    case OP_LOOP:   return 1;
+    case OP_LOOPZ:  return cpu->f[ZF];
+    case OP_LOOPNZ: return !cpu->f[ZF];
+    default:        return 0;
+    }
+}
+
+// "jne label_3" or, for targets the analysis could not label, "jne -6".
+static int parse_target(char *p, Instr *in) {
+    while (*p && isspace((unsigned char)*p)) p++;
+
+    if (strncmp(p, "label_", 6) == 0) {
+        long n = strtol(p + 6, NULL, 10);
+        if (n < 0 || n >= MAX_LINES) return 0;
+        in->target = label_addr[n];
     } else {
-        temp -= cpu->r[reg2];
+        in->target = (uint16_t)(in->next + strtol(p, NULL, 0));
+    }
+    return 1;
+}
+
+static int predecode_line(Instr *in) {
+    char *p = line;
+    p = consume_word(p);
+    in->op = parse_op(word);
+
+    switch (in->op) {
+    case OP_MOV:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_CMP: {
+        int wide;
+        if (!parse_operands(p, &in->dst, &in->src, &wide)) return 0;
+        in->wide = (uint8_t)wide;
+        return 1;
+    }
+
+    case OP_JCC:
+        for (uint8_t i = 0; i < 16; i++)
+            if (strcmp(word, jcc_names[i]) == 0) in->cc = i;
+        return parse_target(p, in);
+
+    case OP_LOOP:
+    case OP_LOOPZ:
+    case OP_LOOPNZ:
+    case OP_JCXZ:
+        return parse_target(p, in);
+
+    default:
+        return 0;
+    }
+}
+
+// Parses every instruction line of the listing into code[] once, so the
+// run loop below never touches text. Without fast_forward no instruction
+// is marked pure or ff, which turns spin and loop skipping off for free.
+static void predecode(FILE *in, const Program *prog, int fast_forward) {
+    size_t n_labels = 0;
+    for (size_t i = 0; i < prog->count; i++)
+        if (prog->kind[i] == LINE_LABEL) label_addr[n_labels++] = prog->addr[i];
+
+    for (size_t a = 0; a < MAX_IMAGE; a++) code_at[a] = -1;
+    image_size = prog->cfg->size;
+
+    size_t n = 0;
+    for (size_t i = 0; i < prog->count && readline(in, line, sizeof(line)); i++) {
+        if (prog->kind[i] != LINE_INSN) continue;
+
+        Instr *ins = &code[n];
+        memset(ins, 0, sizeof(*ins));
+        ins->addr = prog->addr[i];
+        ins->next = (uint16_t)(prog->addr[i] + prog->size[i]);
+        ins->brk  = dbg.n_break && dbg_bit(dbg.break_bits, ins->addr);
+
+        if (!predecode_line(ins)) ins->op = OP_UNKNOWN;
+        instr_cycles(ins);
+        if (ins->op == OP_MOV || ins->op == OP_ADD || ins->op == OP_SUB || ins->op == OP_CMP)
+            ins->exec = pick_handler(ins);
+        ins->pure = fast_forward &&
+                    (ins->op == OP_CMP || ins->op == OP_JCC || ins->op == OP_JCXZ);
+        code_at[ins->addr] = (int32_t)n++;
     }
 
-    //zf
-    if(temp == 0) cpu->f[ZF] = 1;
-    else cpu->f[ZF] = 0;
+    if (fast_forward)
+        for (size_t i = 0; i < n; i++) mark_counted_loop(&code[i], prog);
+
+    // Breakpoints are only checked where an instruction starts.
+    if (dbg.n_break)
+        for (uint32_t a = 0; a < MAX_IMAGE; a++)
+            if (dbg_bit(dbg.break_bits, a) && code_at[a] < 0)
+                fprintf(stderr, "Breakpoint at %04X is not at an instruction and will never fire\n", a);
+}
 
-    //sf
-    temp = (cpu->r[reg1] & 0xFFFF) >> 15;
+void simulate_load(FILE *in, const Program *prog, int fast_forward) {
+    predecode(in, prog, fast_forward);
 }
 
+uint64_t simulate(CPU *cpu, uint64_t max_steps) {
+    // Spin-wait detection (Brent's cycle finding): a run of pure
+    // instructions that comes back to the same IP with the same flags
+    // will repeat forever, since nothing else it reads can have changed.
+    uint16_t spin_ip = 0;
+    uint64_t spin_steps = 0, spin_cycles = 0, spin_window = 0;
+    uint8_t spin_flags[F_UNKNOWN];
 
+    uint64_t steps = 0;
+    while (!max_steps || steps < max_steps) {
+        int32_t idx = code_at[cpu->ip];
+        if (idx < 0) {
+            // Inside the image this is a byte the decoder left as data.
+            if (cpu->ip < image_size) {
+                fprintf(stderr, "Cannot execute instruction at %04X\n", cpu->ip);
+                sim_fault = 1;
+            }
+            break;              // ran off the end of the code
+        }
 
-void simulate(CPU *cpu, FILE *in) {
+        const Instr *ins = &code[idx];
+        if (ins->brk) {
+            dbg.hit = (DbgHit){ DBG_BREAK, ins->addr, ins->addr };
+            return steps;
+        }
 
-    while(readline(in, line, sizeof(line))){
-        sscanf(line, "%31s", word);
-        Op op = parse_op(&word);
-        switch (op) {
+        if (!ins->pure) {
+            spin_window = 0;
+        } else if (spin_window && cpu->ip == spin_ip &&
+                   memcmp(spin_flags, cpu->f, sizeof(spin_flags)) == 0) {
+            // No timers or interrupts are modelled, so the next event
+            // that could break the spin is the step limit.
+            if (!max_steps) {
+                fprintf(stderr, "Spin-wait at %04X never exits\n", cpu->ip);
+                break;
+            }
+            uint64_t period = steps - spin_steps;
+            uint64_t k = (max_steps - steps) / period;
+            uint32_t pass = prof.period ? spin_pass(cpu, period) : 1;
+            if (pass) {
+                prof_skip(pass_ips, pass, k * period);
+                steps += k * period;
+                cpu->cycles += k * (cpu->cycles - spin_cycles);
+            }
+            spin_window = 0;
+            if (steps >= max_steps) break;
+        } else if (!spin_window || steps - spin_steps >= spin_window) {
+            spin_ip = cpu->ip;
+            spin_steps = steps;
+            spin_cycles = cpu->cycles;
+            memcpy(spin_flags, cpu->f, sizeof(spin_flags));
+            spin_window = spin_window ? spin_window * 2 : 2;
+        }
+
+        if (ins->ff && loop_keeps_going(cpu, ins)) {
+            // Loop executions left, this one included; CX == 0 wraps.
+            uint64_t n = cpu->r[CX] ? cpu->r[CX] : 0x10000;
+            uint64_t total = n + (n - 1) * ins->ff_steps;
+
+            uint32_t pass = prof.period ? loop_pass(ins) : 1;
+            if (pass && (!max_steps || steps + total <= max_steps)) {
+                prof_skip(pass_ips, pass, total);
+                cpu->r[CX] = 0;
+                cpu->cycles += (n - 1) * (ins->taken_cycles + ins->ff_cycles) + ins->cycles;
+                cpu->ip = ins->next;
+                steps += total;
+                continue;
+            }
+        }
+
+        prof_tick(ins->addr);
+
+        uint16_t next = ins->next;
+        switch (ins->op) {
         case OP_MOV:
-            simulate_mov(cpu);
-            break;
-        
         case OP_ADD:
-            simulate_add(cpu);
-            break;
-
         case OP_SUB:
-            simulate_sub(cpu);
+        case OP_CMP:
+            ins->exec(cpu, ins);
+            cpu->cycles += ins->cycles;
             break;
 
-        case OP_CMP:
-            simulate_cmp(cpu);
+        case OP_JCC:
+        case OP_LOOP:
+        case OP_LOOPZ:
+        case OP_LOOPNZ:
+        case OP_JCXZ:
+            if (simulate_branch(cpu, ins)) {
+                next = ins->target;
+                cpu->cycles += ins->taken_cycles;
+            } else {
+                cpu->cycles += ins->cycles;
+            }
             break;
 
         default:
-            break;
+            fprintf(stderr, "Cannot execute instruction at %04X\n", cpu->ip);
+            sim_fault = 1;
+            return steps;
         }
+
+        cpu->ip = next;
+        steps++;
+        if (dbg.n_watch && dbg.hit.kind != DBG_NONE) break;
+    }
+
+    if (max_steps && steps >= max_steps)
+        fprintf(stderr, "Stopped after %llu instructions (step limit)\n",
+                (unsigned long long)steps);
+    return steps;
+}
+
+#ifndef NO_SPECIALISED_HANDLERS
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static double rate(CPU *cpu, ExecFn fn, const Instr *in, uint64_t n) {
+    uint64_t t0 = now_ns();
+    for (uint64_t i = 0; i < n; i++) fn(cpu, in);
+    uint64_t t1 = now_ns();
+    return t1 > t0 ? (double)n * 1000.0 / (double)(t1 - t0) : 0.0;
+}
+
+static void sample_operand(Operand *o, Form form, int wide) {
+    memset(o, 0, sizeof(*o));
+    o->base = o->index = REG_UNKNOWN;
+
+    switch (form) {
+    case FORM_R:   o->kind = wide ? OPND_REG16 : OPND_REG8; o->reg = DX; break;
+    case FORM_I:   o->kind = OPND_IMM; o->imm = 3; break;
+    case FORM_MD:  o->kind = OPND_MEM; o->disp = 0x100; break;
+    case FORM_MB:  o->kind = OPND_MEM; o->base = BX; o->disp = 4; o->has_disp = 1; break;
+    case FORM_MBX: o->kind = OPND_MEM; o->base = BX; o->index = SI; o->disp = 4; o->has_disp = 1; break;
+    }
+}
+
+void simulate_bench_handlers(uint64_t n) {
+    static CPU bench_cpu;
+    cpu_init(&bench_cpu);
+    bench_cpu.r[BX] = 0x200;
+    bench_cpu.r[SI] = 0x10;
+
+    printf("%-20s %12s %12s\n", "variant", "spec M/s", "generic M/s");
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        const Variant *v = &variants[i];
+        Instr in;
+        memset(&in, 0, sizeof(in));
+        in.op = v->op;
+        in.wide = v->wide;
+        sample_operand(&in.dst, v->dst, v->wide);
+        sample_operand(&in.src, v->src, v->wide);
+
+        ExecFn generic = v->op == OP_MOV ? simulate_mov : simulate_alu;
+        printf("%-20s %12.1f %12.1f\n", v->name,
+               rate(&bench_cpu, v->fn, &in, n), rate(&bench_cpu, generic, &in, n));
     }
-}
\ No newline at end of file
+}
+
+#else
+
+void simulate_bench_handlers(uint64_t n) {
+    (void)n;
+    printf("specialised handlers are compiled out (NO_SPECIALISED_HANDLERS)\n");
+}
+
+#endif // NO_SPECIALISED_HANDLERS
@@ -3,7 +3,24 @@
 
 #include <stdio.h>
 #include "cpu.h"
+#include "decoder.h"
 
-void simulate(CPU *cpu, FILE *in);
+// Parses the decoded listing into the instruction table simulate() runs.
+// fast_forward enables closed-form counted loops and spin-wait skipping;
+// results are the same either way.
+void simulate_load(FILE *in, const Program *prog, int fast_forward);
 
-#endif
\ No newline at end of file
+// Set when a run stopped at an instruction it cannot execute.
+extern int sim_fault;
+
+// Runs the loaded program from cpu->ip until execution leaves the code,
+// max_steps instructions have run (0 = no limit), a breakpoint/
+// watchpoint fires (dbg.hit says which), or it reaches an instruction it
+// cannot execute (sim_fault). Returns the number of instructions executed.
+uint64_t simulate(CPU *cpu, uint64_t max_steps);
+
+// Times every specialised mov/add/sub/cmp handler against the generic
+// one, n executions each, and prints millions of executions per second.
+void simulate_bench_handlers(uint64_t n);
+
+#endif
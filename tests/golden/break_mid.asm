@@ -0,0 +1,3 @@
+mov ax, 1
+mov bx, 2
+mov cx, 3
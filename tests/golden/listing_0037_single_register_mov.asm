@@ -0,0 +1 @@
+mov cx, bx
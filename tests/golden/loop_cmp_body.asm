@@ -0,0 +1,23 @@
+mov cx, 0
+label_0:
+cmp ax, bx
+cmp dx, 5
+loop label_0
+mov cx, 500
+mov ax, 7
+mov bx, 7
+label_1:
+cmp ax, bx
+loopz label_1
+mov dx, cx
+mov cx, 300
+mov ax, 1
+label_2:
+cmp ax, bx
+loopnz label_2
+mov si, cx
+mov cx, 40
+label_3:
+cmp ax, bx
+loopz label_3
+mov di, cx
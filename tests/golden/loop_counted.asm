@@ -0,0 +1,4 @@
+mov cx, 1000
+label_0:
+loop label_0
+mov ax, cx
@@ -0,0 +1,2 @@
+label_0:
+jcxz label_0
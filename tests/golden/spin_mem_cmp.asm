@@ -0,0 +1,5 @@
+mov ax, 5
+mov [100], ax
+label_0:
+cmp word [100], 5
+je label_0
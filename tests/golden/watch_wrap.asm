@@ -0,0 +1,3 @@
+mov ax, 4660
+mov [65535], ax
+mov bx, 1
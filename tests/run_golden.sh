@@ -0,0 +1,135 @@
+#!/bin/sh
+# Runs every listing in resources/ and the loop/spin binaries in
+# tests/corpus/ and compares the decoded text, the final CPU state and a
+# --profile taken every SAMPLE_EVERY (default 7) instructions against
+# tests/golden/. Each binary is run again with --no-fast-forward and must
+# reach the same state and the same profile. A corpus binary with a NAME.args file
+# next to it is run with those extra options every time (breakpoints,
+# watchpoints). Also times each binary and
+# fails when it gets slower than its recorded baseline by more than
+# PERF_TOLERANCE (default 3x).
+#
+#   tests/run_golden.sh build/8086sim            check
+#   UPDATE=1 tests/run_golden.sh build/8086sim   re-record goldens + timings
+#
+# The timed figure is nanoseconds per executed instruction, best of RUNS
+# (default 5). Timing runs use --no-fast-forward, so every counted
+# instruction really went through the run loop, and each one executes
+# about BUDGET (default 200000) instructions: short programs are repeated
+# in-process (at most REPEAT times, default 1000), long ones are cut off
+# by --max-steps. Loading the listing is not part of it. Baselines are
+# machine-specific: re-record them on the machine that runs the gate.
+
+SIM=${1:-build/8086sim}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+GOLDEN="$ROOT/tests/golden"
+TIMINGS="$GOLDEN/timings.txt"
+RUNS=${RUNS:-5}
+REPEAT=${REPEAT:-1000}
+BUDGET=${BUDGET:-200000}
+SAMPLE_EVERY=${SAMPLE_EVERY:-7}
+PERF_TOLERANCE=${PERF_TOLERANCE:-3}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+fail=0
+: > "$TMP/timings.txt"
+
+for bin in "$ROOT"/resources/listing_* "$ROOT"/tests/corpus/*; do
+    case $bin in *.args) continue ;; esac
+    name=$(basename "$bin")
+    args=$(cat "$bin.args" 2> /dev/null)
+    status=ok
+
+    # Folded stacks come out in hash-table order; sort them to compare.
+    "$SIM" "$bin" "$TMP/$name.asm" $args --profile "$TMP/prof" \
+        --sample-every "$SAMPLE_EVERY" > "$TMP/$name.state" 2> "$TMP/$name.err"
+    rc=$?
+    sort "$TMP/prof" > "$TMP/$name.folded" 2> /dev/null
+    if [ "$rc" -ne 0 ]; then
+        cat "$TMP/$name.err"
+        status="FAIL (exit status $rc)"
+    fi
+
+    "$SIM" "$bin" "$TMP/run.asm" $args --no-fast-forward --time --profile "$TMP/prof" \
+        --sample-every "$SAMPLE_EVERY" > "$TMP/$name.stepped.state" 2> "$TMP/$name.err"
+    rc=$?
+    sort "$TMP/prof" > "$TMP/$name.stepped.folded" 2> /dev/null
+    if [ "$rc" -ne 0 ]; then
+        cat "$TMP/$name.err"
+        status="FAIL (--no-fast-forward exit status $rc)"
+    fi
+    for kind in state folded; do
+        [ "$rc" -eq 0 ] || break
+        if ! diff -u "$TMP/$name.$kind" "$TMP/$name.stepped.$kind" > "$TMP/diff"; then
+            cat "$TMP/diff"
+            status="FAIL (--no-fast-forward $kind differs)"
+        fi
+    done
+
+    insns=$(awk '/^time:/ { print $4 }' "$TMP/$name.err")
+    rep=$(awk -v n="${insns:-0}" -v b="$BUDGET" -v r="$REPEAT" \
+          'BEGIN { k = n ? int(b / n) : 1; if (k < 1) k = 1; if (k > r) k = r; print k }')
+
+    best=
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        "$SIM" "$bin" "$TMP/run.asm" $args --no-fast-forward --time \
+            --repeat "$rep" --max-steps "$BUDGET" > /dev/null 2> "$TMP/time"
+        rc=$?
+        t=$(awk '/^time:/ { print $6 }' "$TMP/time")
+        if [ "$rc" -ne 0 ] || [ -z "$t" ]; then
+            cat "$TMP/time"
+            status="FAIL (timing run exit status $rc)"
+            best=
+            break
+        fi
+        if [ -z "$best" ] || awk -v t="$t" -v b="$best" 'BEGIN { exit !(t < b) }'; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+
+    if [ -n "$UPDATE" ]; then
+        if [ "$status" != ok ] || [ -z "$best" ]; then
+            echo "$name: $status"
+            fail=1
+            continue
+        fi
+        cp "$TMP/$name.asm" "$GOLDEN/$name.asm"
+        cp "$TMP/$name.state" "$GOLDEN/$name.state"
+        cp "$TMP/$name.folded" "$GOLDEN/$name.folded"
+        echo "$name $best" >> "$TMP/timings.txt"
+        echo "recorded $name ($best ns/instruction)"
+        continue
+    fi
+
+    for kind in asm state folded; do
+        if ! diff -u "$GOLDEN/$name.$kind" "$TMP/$name.$kind" > "$TMP/diff"; then
+            cat "$TMP/diff"
+            status="FAIL ($kind differs)"
+        fi
+    done
+
+    base=$(awk -v n="$name" '$1 == n { print $2 }' "$TIMINGS" 2> /dev/null)
+    if [ -z "$base" ]; then
+        status="FAIL (no timing baseline)"
+    elif [ -n "$best" ] &&
+         awk -v t="$best" -v b="$base" -v k="$PERF_TOLERANCE" 'BEGIN { exit !(t > b * k) }'; then
+        status="FAIL ($best ns/instruction, baseline $base)"
+    fi
+
+    printf '%-40s %12s ns/insn  %s\n' "$name" "$best" "$status"
+    case $status in ok) ;; *) fail=1 ;; esac
+done
+
+if [ -n "$UPDATE" ]; then
+    if [ "$fail" -ne 0 ]; then
+        echo "timings not recorded"
+    else
+        cp "$TMP/timings.txt" "$TIMINGS"
+    fi
+fi
+
+exit $fail